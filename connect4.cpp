@@ -0,0 +1,482 @@
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+// 7 columns of 6 rows, each column gets an extra sentinel bit on top so
+// shifting by a column never carries into the next one
+// bit index is column * 7 + row with row 0 at the bottom
+static constexpr int WIDTH = 7;
+static constexpr int HEIGHT = 6;
+static constexpr int H1 = HEIGHT + 1;
+
+constexpr uint64_t bottom_mask_col(int col) {
+    return 1ULL << (col * H1);
+}
+
+constexpr uint64_t top_mask_col(int col) {
+    return 1ULL << (HEIGHT - 1 + col * H1);
+}
+
+constexpr uint64_t column_mask(int col) {
+    return ((1ULL << HEIGHT) - 1) << (col * H1);
+}
+
+constexpr uint64_t bottom_mask() {
+    uint64_t mask = 0ULL;
+    for (int col = 0; col < WIDTH; ++col)
+        mask |= bottom_mask_col(col);
+    return mask;
+}
+
+static constexpr uint64_t BOTTOM = bottom_mask();
+static constexpr uint64_t FULL_BOARD = BOTTOM * ((1ULL << HEIGHT) - 1);
+
+// center columns first, they take part in the most alignments
+static constexpr int COLUMN_ORDER[WIDTH] = {3, 2, 4, 1, 5, 0, 6};
+
+// four in a row in any direction, one shift-and-and per direction
+constexpr bool alignment(uint64_t pos) {
+    // horizontal, diagonals and vertical
+    for (int shift : {H1, H1 - 1, H1 + 1, 1}) {
+        uint64_t pairs = pos & (pos >> shift);
+        if (pairs & (pairs >> (2 * shift)))
+            return true;
+    }
+    return false;
+}
+
+// current holds the markers of the side to move, mask holds every marker
+// current + mask is unique for every position so it is used as the tt key
+struct position {
+    uint64_t current;
+    uint64_t mask;
+    int moves;
+
+    constexpr bool can_play(int col) const {
+        return (mask & top_mask_col(col)) == 0;
+    }
+
+    // adding the bottom bit of a column carries up to the first empty cell
+    constexpr void play(int col) {
+        current ^= mask;
+        mask |= mask + bottom_mask_col(col);
+        ++moves;
+    }
+
+    constexpr bool is_winning_move(int col) const {
+        uint64_t pos = current | ((mask + bottom_mask_col(col)) & column_mask(col));
+        return alignment(pos);
+    }
+
+    constexpr uint64_t key() const {
+        return current + mask;
+    }
+
+    // empty squares that would complete four for the side that just moved
+    constexpr uint64_t opponent_winning_positions() const {
+        return compute_winning_positions(current ^ mask, mask);
+    }
+
+    constexpr uint64_t possible() const {
+        return (mask + BOTTOM) & FULL_BOARD;
+    }
+
+    // moves that don't hand the opponent a win, 0 if every move loses
+    constexpr uint64_t possible_non_losing_moves() const {
+        uint64_t possible_mask = possible();
+        uint64_t opponent_win = opponent_winning_positions();
+        uint64_t forced_moves = possible_mask & opponent_win;
+        if (forced_moves) {
+            // two threats can't both be blocked
+            if (forced_moves & (forced_moves - 1))
+                return 0;
+            possible_mask = forced_moves;
+        }
+        // don't play right under an opponent's winning square
+        return possible_mask & ~(opponent_win >> 1);
+    }
+
+    // how many squares the side to move could win on after playing move ( a single bit )
+    int move_score(uint64_t move) const {
+        return __builtin_popcountll(compute_winning_positions(current | move, mask));
+    }
+
+    static constexpr uint64_t compute_winning_positions(uint64_t pos, uint64_t mask) {
+        // vertical
+        uint64_t r = (pos << 1) & (pos << 2) & (pos << 3);
+
+        for (int shift : {H1, H1 - 1, H1 + 1}) {
+            uint64_t p = (pos << shift) & (pos << 2 * shift);
+            r |= p & (pos << 3 * shift);
+            r |= p & (pos >> shift);
+            p = (pos >> shift) & (pos >> 2 * shift);
+            r |= p & (pos << shift);
+            r |= p & (pos >> 3 * shift);
+        }
+        return r & (FULL_BOARD ^ mask);
+    }
+};
+
+// columns are written 1-7 like most connect four solvers, returns false on an illegal move
+// or a move after the game was won
+bool play_moves(position &pos, const string &moves) {
+    for (char c : moves) {
+        int col = c - '1';
+        if (col < 0 || col >= WIDTH || !pos.can_play(col) || pos.is_winning_move(col))
+            return false;
+        pos.play(col);
+    }
+    return true;
+}
+
+// 2 ^ n - 1
+// for fast 'modulus'
+uint32_t const hash_size = (1u << 22) - 1;
+
+#define hash_flag_exact 0
+#define hash_flag_alpha 1
+#define hash_flag_beta 2
+
+struct tt {
+    uint64_t hash_key;
+    int value;
+    uint8_t flag;
+};
+
+tt hash_table[hash_size + 1];
+
+void clear_hash_table() {
+    for (uint32_t i = 0; i <= hash_size; ++i) {
+        hash_table[i].hash_key = 0ULL;
+        hash_table[i].value = 0;
+        hash_table[i].flag = 0u;
+    }
+}
+
+void write_hash_entry(uint64_t hash_key, uint8_t hash_flag, int value) {
+    tt *hash_entry = &hash_table[hash_key & hash_size];
+
+    hash_entry->hash_key = hash_key;
+    hash_entry->value = value;
+    hash_entry->flag = hash_flag;
+}
+
+uint64_t nodes_searched = 0;
+
+// score is positive if the side to move wins, the sooner the win the higher the score
+// ( remaining moves of the winner / 2 ), 0 is a draw
+// assumes the side to move can't win right away
+int negamax(const position &pos, int alpha, int beta) {
+    int alpha_orig = alpha;
+    ++nodes_searched;
+
+    uint64_t next = pos.possible_non_losing_moves();
+    // every move lets the opponent win
+    if (!next)
+        return -(WIDTH * HEIGHT - pos.moves) / 2;
+
+    // draw if the board is full after the opponent's reply
+    if (pos.moves >= WIDTH * HEIGHT - 2)
+        return 0;
+
+    // the opponent can't win on their next move so the score is above this
+    int min_score = -(WIDTH * HEIGHT - 2 - pos.moves) / 2;
+    if (alpha < min_score) {
+        alpha = min_score;
+        if (alpha >= beta)
+            return alpha;
+    }
+
+    // and we can't win on this move so it is below this
+    int max_score = (WIDTH * HEIGHT - 1 - pos.moves) / 2;
+    if (beta > max_score) {
+        beta = max_score;
+        if (alpha >= beta)
+            return beta;
+    }
+
+    // see if this position is in the transposition table
+    uint64_t key = pos.key();
+    tt entry = hash_table[key & hash_size];
+    if (entry.hash_key == key) {
+        if (entry.flag == hash_flag_exact)
+            return entry.value;
+        else if (entry.flag == hash_flag_alpha)
+            alpha = max(alpha, entry.value);
+        else if (entry.flag == hash_flag_beta)
+            beta = min(beta, entry.value);
+
+        if (alpha >= beta)
+            return entry.value;
+    }
+
+    // moves that make the most threats go first, insertion sort keeps
+    // the center first order between moves with the same score
+    int cols[WIDTH];
+    int scores[WIDTH];
+    int num_moves = 0;
+    for (int col : COLUMN_ORDER) {
+        uint64_t move = next & column_mask(col);
+        if (!move)
+            continue;
+
+        int score = pos.move_score(move);
+        int i = num_moves++;
+        for (; i && scores[i - 1] < score; --i) {
+            cols[i] = cols[i - 1];
+            scores[i] = scores[i - 1];
+        }
+        cols[i] = col;
+        scores[i] = score;
+    }
+
+    int value = -WIDTH * HEIGHT;
+    for (int i = 0; i < num_moves; ++i) {
+        position child = pos;
+        child.play(cols[i]);
+        value = max(value, -negamax(child, -beta, -alpha));
+
+        alpha = max(alpha, value);
+        if (alpha >= beta)
+            break;
+    }
+
+    // adding position in tt
+    if (value <= alpha_orig)
+        write_hash_entry(key, hash_flag_beta, value);
+    else if (value >= beta)
+        write_hash_entry(key, hash_flag_alpha, value);
+    else
+        write_hash_entry(key, hash_flag_exact, value);
+    return value;
+}
+
+// exact score of a position, narrowing the window with null window searches
+// that are cheap and fill the tt for the next one
+int solve(const position &pos) {
+    for (int col = 0; col < WIDTH; ++col)
+        if (pos.can_play(col) && pos.is_winning_move(col))
+            return (WIDTH * HEIGHT + 1 - pos.moves) / 2;
+
+    int min_score = -(WIDTH * HEIGHT - pos.moves) / 2;
+    int max_score = (WIDTH * HEIGHT + 1 - pos.moves) / 2;
+    while (min_score < max_score) {
+        int med = min_score + (max_score - min_score) / 2;
+        // look closer to 0 first, most positions are decided by a small margin
+        if (med <= 0 && min_score / 2 < med)
+            med = min_score / 2;
+        else if (med >= 0 && max_score / 2 > med)
+            med = max_score / 2;
+
+        int value = negamax(pos, med, med + 1);
+        if (value <= med)
+            max_score = value;
+        else
+            min_score = value;
+    }
+    return min_score;
+}
+
+int find_best_move(const position &pos, int &best_val) {
+    best_val = -WIDTH * HEIGHT;
+    int best_move = -1;
+
+    for (int col : COLUMN_ORDER) {
+        if (!pos.can_play(col))
+            continue;
+        if (pos.is_winning_move(col)) {
+            best_val = (WIDTH * HEIGHT + 1 - pos.moves) / 2;
+            return col;
+        }
+
+        position child = pos;
+        child.play(col);
+        // a full board after this move is a draw
+        int move_val = child.moves == WIDTH * HEIGHT ? 0 : -solve(child);
+        if (move_val > best_val) {
+            best_move = col;
+            best_val = move_val;
+        }
+    }
+    return best_move;
+}
+
+void print_board(const position &pos) {
+    // the side that moved first is X
+    uint64_t x_board = pos.moves % 2 ? pos.current ^ pos.mask : pos.current;
+    for (int row = HEIGHT - 1; row >= 0; --row) {
+        for (int col = 0; col < WIDTH; ++col) {
+            uint64_t idx = 1ULL << (col * H1 + row);
+            if (x_board & idx)
+                cout << "X ";
+            else if (pos.mask & idx)
+                cout << "O ";
+            else
+                cout << ". ";
+        }
+        cout << endl;
+    }
+    for (int col = 0; col < WIDTH; ++col)
+        cout << col + 1 << " ";
+    cout << endl;
+}
+
+// the game can start from moves already played since solving
+// the first dozen moves of a game takes a long time
+void play_game(bool human_goes_first, const position &start_pos) {
+    position pos = start_pos;
+
+    // keep track of whose turn it is
+    bool player_turn = human_goes_first;
+
+    chrono::time_point<chrono::steady_clock> start, end;
+
+    cout << "Game starting" << endl;
+    print_board(pos);
+
+    while (true) {
+        int col;
+        if (player_turn) {
+            cout << "Choose a column to play" << endl;
+            int move;
+            if (!(cin >> move))
+                return;
+            col = move - 1;
+            if (col < 0 || col >= WIDTH || !pos.can_play(col)) {
+                cout << "Column " << move << " can't be played" << endl;
+                continue;
+            }
+        }
+        else {
+            int best_val;
+            nodes_searched = 0;
+            start = chrono::steady_clock::now();
+            col = find_best_move(pos, best_val);
+            end = chrono::steady_clock::now();
+
+            double elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+
+            cout << "Search time nanoseconds: " << elapsed_time << endl;
+            cout << fixed << "Search time seconds: " << elapsed_time / 1e9 << endl;
+            cout << "Nodes searched: " << nodes_searched << endl;
+            cout << "Score: " << best_val << endl;
+            cout << "Agent played column " << col + 1 << endl;
+            cout << endl;
+        }
+
+        bool won = pos.is_winning_move(col);
+        pos.play(col);
+        print_board(pos);
+
+        // terminal conditions
+        if (won) {
+            cout << (player_turn ? "Player wins" : "Agent wins") << endl;
+            break;
+        }
+        else if (pos.moves == WIDTH * HEIGHT) {
+            cout << "Game is drawn" << endl;
+            break;
+        }
+        player_turn = !player_turn;
+    }
+}
+
+struct bench_position {
+    const char *moves;
+    int score;
+};
+
+// positions for the benchmark with their exact scores, columns 1-7 from the empty board
+// the first is line 1 of Pascal Pons' Test_L3_R1 endgame set, the rest are random games
+// of 12 to 24 moves where nobody can win on the next move, scored by this solver
+static const bench_position bench_positions[] = {
+    {"2252576253462244111563365343671351441", -1},
+    {"531544344267", 0}, {"355517617235", 5},
+    {"7543236114622456", -5}, {"1432344443142663", 2}, {"3172145121266451", -1}, {"5514471731123213", -4},
+    {"65545356755717632643", 0}, {"43234265656641243523", 2}, {"17365514436574614124", -2},
+    {"33352723423523215747", 3}, {"32445153331122163426", -2}, {"76221352363653556745", -1},
+    {"541365362516622566552224", 1}, {"753335664141632626743146", -2}, {"232227475667317633772334", -6},
+    {"325421111622741515226757", -2}
+};
+
+// returns false if a bench position doesn't parse or solves to the wrong score
+bool run_bench() {
+    chrono::time_point<chrono::steady_clock> start, end;
+    double total_time = 0;
+    double max_time = 0;
+    uint64_t total_nodes = 0;
+
+    for (const bench_position &bench : bench_positions) {
+        const char *moves = bench.moves;
+        position pos = {0ULL, 0ULL, 0};
+        if (!play_moves(pos, moves) || pos.moves == WIDTH * HEIGHT) {
+            cerr << "can't bench " << moves << endl;
+            return false;
+        }
+
+        clear_hash_table();
+        nodes_searched = 0;
+        start = chrono::steady_clock::now();
+        int score = solve(pos);
+        end = chrono::steady_clock::now();
+
+        double elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+        total_time += elapsed_time;
+        max_time = max(max_time, elapsed_time);
+        total_nodes += nodes_searched;
+
+        cout << moves << " score " << score << " nodes " << nodes_searched << fixed << " seconds " << elapsed_time / 1e9 << endl;
+        if (score != bench.score) {
+            cerr << "wrong score for " << moves << ", expected " << bench.score << endl;
+            return false;
+        }
+    }
+
+    cout << "Positions: " << size(bench_positions) << endl;
+    cout << fixed << "Average time to solve seconds: " << total_time / 1e9 / size(bench_positions) << endl;
+    cout << fixed << "Max time to solve seconds: " << max_time / 1e9 << endl;
+    cout << "Average nodes: " << total_nodes / size(bench_positions) << endl;
+    cout << fixed << "Nodes per second: " << total_nodes / (total_time / 1e9) << endl;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    clear_hash_table();
+
+    string mode = argc > 1 ? argv[1] : "";
+
+    // ./connect4.out solve 4453
+    if (mode == "solve") {
+        position pos = {0ULL, 0ULL, 0};
+        if (!play_moves(pos, argc > 2 ? argv[2] : "") || pos.moves == WIDTH * HEIGHT) {
+            cerr << "can't solve " << (argc > 2 ? argv[2] : "") << endl;
+            return 1;
+        }
+
+        int best_val;
+        int best_move = find_best_move(pos, best_val);
+        cout << "Score: " << best_val << endl;
+        cout << "Best column: " << best_move + 1 << endl;
+        return 0;
+    }
+    // ./connect4.out bench
+    if (mode == "bench") {
+        return run_bench() ? 0 : 1;
+    }
+
+    // ./connect4.out play [moves]
+    position pos = {0ULL, 0ULL, 0};
+    if (mode == "play" && argc > 2 && (!play_moves(pos, argv[2]) || pos.moves == WIDTH * HEIGHT)) {
+        cerr << "can't play from " << argv[2] << endl;
+        return 1;
+    }
+
+    bool human_goes_first = true;
+    play_game(human_goes_first, pos);
+
+    return 0;
+}
@@ -1,7 +1,26 @@
+#include <array>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <atomic>
 #include <random>
 #include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <condition_variable>
 
 using namespace std;
 
@@ -26,57 +45,178 @@ static constexpr uint16_t WINNING_PATTERNS[] = {
     DIAG_UP, DIAG_DOWN
 };
 
-// key for transposition table 
-uint64_t hash_key = 0;
+// fixed seed so every run ( and every snapshot / benchmark ) hashes positions the same way
+static constexpr uint64_t zobrist_seed = 0x9e3779b97f4a7c15ULL;
 
-// this generates random numbers for our board position 
-uint64_t marker_keys[2][9];
-
-void init_random_keys() {
-    random_device rd;
-    mt19937_64 gen(rd());
-    uniform_int_distribution<uint64_t> dis;
+// splitmix64, small enough to run in a constexpr
+constexpr uint64_t next_random_key(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
 
+constexpr array<array<uint64_t, 9>, 2> generate_marker_keys(uint64_t seed) {
+    array<array<uint64_t, 9>, 2> keys{};
     // looping over players ( X and O )
-    for (int i = 0; i < 2; ++i) 
+    for (int i = 0; i < 2; ++i)
         // looping over board coordinates
-        for (int j = 0; j < 9; ++j) 
-            marker_keys[i][j] = dis(gen);
+        for (int j = 0; j < 9; ++j)
+            keys[i][j] = next_random_key(seed);
+    return keys;
 }
 
-// i think this is mainly for starting positions
-// since the board is empty it should just be 0 
-// will need this for snakes 
-uint64_t generate_hash_key(uint16_t player, uint16_t agent) {
+// random numbers for our board position, built by the compiler so startup does no work
+static constexpr array<array<uint64_t, 9>, 2> marker_keys = generate_marker_keys(zobrist_seed);
+
+// the full rehash, make_move / unmake_move keep the key up to date incrementally
+// 0 is player ; 1 is agent ; index is the coordinate of the marker 
+constexpr uint64_t generate_hash_key(uint16_t player, uint16_t agent) {
     uint64_t final_key = 0ULL;
 
-    // player bitboard should be moved to global 
-    uint16_t temp_board = player;
-    int index;
-    
     uint16_t boards[] = {player, agent};
 
-    for (uint16_t temp_board : boards) {
+    for (int marker = 0; marker < 2; ++marker) {
+        uint16_t temp_board = boards[marker];
         while (temp_board) {
-            
-            index = __builtin_ctz(temp_board);
+            int index = __builtin_ctz(temp_board);
             // hash the piece
-            // 0 is player ; 1 is agent ; index is random int coordinate of the marker 
-            // TODO : for snakes , need first index to be player/agent 
-            final_key ^= marker_keys[0][index];
+            final_key ^= marker_keys[marker][index];
             // pop lsb 
-            temp_board ^= index; 
+            temp_board &= temp_board - 1;
         }
     }
     return final_key;
 }
 
+// wins are scored WIN_SCORE minus the markers on the board so faster wins score higher
+// heuristic scores of unfinished positions have to stay well below that
+static constexpr int WIN_SCORE = 1000;
+static constexpr int MAX_HEURISTIC = WIN_SCORE / 2;
+
+// the lines ( WINNING_PATTERNS ) going through each square, 2 to 4 of them
+struct square_lines {
+    int count;
+    uint16_t lines[4];
+};
+
+constexpr array<square_lines, 9> generate_square_lines() {
+    array<square_lines, 9> squares{};
+    for (int square = 0; square < 9; ++square)
+        for (uint16_t pattern : WINNING_PATTERNS)
+            if (pattern >> square & 1u)
+                squares[square].lines[squares[square].count++] = pattern;
+    return squares;
+}
+
+static constexpr array<square_lines, 9> SQUARE_LINES = generate_square_lines();
+
+// score of an open line ( only one side has markers in it ) by how many markers it has
+// loaded from a file with --weights, 0 markers and 3 markers ( a win ) are never scored
+int heuristic_weights[4] = {0, 1, 4, 0};
+
+// line_scores[player markers][agent markers] for one line from the agent's point of view
+int line_scores[4][4];
+
+void update_line_scores() {
+    for (int player = 0; player < 4; ++player) {
+        for (int agent = 0; agent < 4; ++agent) {
+            line_scores[player][agent] = 0;
+            if (player && !agent)
+                line_scores[player][agent] = -heuristic_weights[player];
+            else if (agent && !player)
+                line_scores[player][agent] = heuristic_weights[agent];
+        }
+    }
+}
+
+// the whole heuristic from scratch, make_move / unmake_move only update the lines of one square
+int evaluate_heuristic(uint16_t player, uint16_t agent) {
+    int score = 0;
+    for (uint16_t pattern : WINNING_PATTERNS)
+        score += line_scores[__builtin_popcount(player & pattern)][__builtin_popcount(agent & pattern)];
+    return score;
+}
+
+// only depth limited searches need the heuristic, exact searches skip keeping it up to date
+// with this off the heuristic is recomputed where it's needed
+thread_local bool incremental_heuristic = false;
+
+// weights file: the score of an open line with one marker then with two markers
+// the weights have to keep every heuristic score under MAX_HEURISTIC
+bool load_weights(const char *path) {
+    ifstream file(path);
+    int one, two;
+    if (!(file >> one >> two) || one < 0 || two < 0 || 8 * max(one, two) > MAX_HEURISTIC) {
+        cerr << "could not read weights from " << path << endl;
+        return false;
+    }
+    heuristic_weights[1] = one;
+    heuristic_weights[2] = two;
+    update_line_scores();
+    return true;
+}
+
+// everything a search needs to know about the game, small enough to copy around
+// so every thread can search its own position
+struct position {
+    // 0 is player ; 1 is agent 
+    uint16_t boards[2];
+    // whose turn it is, also picks the row of marker_keys
+    bool marker;
+    // heuristic score from the agent's point of view
+    // make_move / unmake_move keep it up to date while incremental_heuristic is set
+    int16_t heuristic;
+    uint64_t hash_key;
+
+    constexpr uint16_t markers() const {
+        return boards[0] | boards[1];
+    }
+
+    // positions where there is an open slot
+    constexpr uint16_t open_squares() const {
+        return (~markers()) ^ OUT_OF_BOUNDS;
+    }
+
+    // how the heuristic changes when marker goes on choice, only the lines through it change
+    int heuristic_change(uint16_t choice) const {
+        int change = 0;
+        const square_lines &square = SQUARE_LINES[choice];
+        for (int i = 0; i < square.count; ++i) {
+            int player = __builtin_popcount(boards[0] & square.lines[i]);
+            int agent = __builtin_popcount(boards[1] & square.lines[i]);
+            change += line_scores[player + !marker][agent + marker] - line_scores[player][agent];
+        }
+        return change;
+    }
+
+    void make_move(uint16_t choice) {
+        if (incremental_heuristic)
+            heuristic += heuristic_change(choice);
+        boards[marker] |= 1u << choice;
+        hash_key ^= marker_keys[marker][choice];
+        marker = !marker;
+    }
+
+    void unmake_move(uint16_t choice) {
+        marker = !marker;
+        boards[marker] ^= 1u << choice;
+        hash_key ^= marker_keys[marker][choice];
+        if (incremental_heuristic)
+            heuristic -= heuristic_change(choice);
+    }
+};
+
+position make_position(uint16_t player, uint16_t agent, bool marker) {
+    return position{{player, agent}, marker, int16_t(evaluate_heuristic(player, agent)), generate_hash_key(player, agent)};
+}
+
 // 2 ^ n - 1
 // for fast 'modulus'
-uint16_t const hash_size = 2047;
-// uint16_t const hash_size = 32767;
-// uint16_t const hash_size = 65535;
-// uint32_t const hash_size = 524288;
+// the default is big enough for every tic tac toe position ( 5478 ) so root moves can share subtrees
+// --tt-mb makes it bigger, see allocate_hash_table
+uint64_t hash_size = 32767;
+static constexpr uint64_t default_hash_slots = 32768;
 
 #define hash_flag_exact 0
 #define hash_flag_alpha 1
@@ -89,38 +229,239 @@ struct tt {
     int value;
 };
 
-tt hash_table[hash_size];
+// entries are packed into one word and stored xored with their key
+// so threads sharing the table never see a torn entry, the key check just fails
+struct tt_slot {
+    atomic<uint64_t> key;
+    atomic<uint64_t> data;
+};
+
+static constexpr uint64_t hash_entry_used = 1ULL << 24;
+
+// hash_size is the mask so the table has hash_size + 1 slots
+tt_slot *hash_table = nullptr;
+
+// what mmap returned, the table itself may start later to line up with a huge page
+void *hash_table_mapping = nullptr;
+size_t hash_table_mapping_bytes = 0;
+
+// how the table is backed, printed by the benchmark
+const char *hash_table_pages = "";
+
+static constexpr size_t huge_page_size = 2 << 20;
+
+void free_hash_table() {
+    if (hash_table_mapping)
+        munmap(hash_table_mapping, hash_table_mapping_bytes);
+    hash_table_mapping = nullptr;
+    hash_table = nullptr;
+}
+
+// num_slots has to be a power of 2, the table comes back cleared since mmap zeroes it
+// with huge_pages a big table gets far fewer tlb misses per probe, it tries MAP_HUGETLB
+// first ( needs pages reserved in vm.nr_hugepages ) then transparent huge pages through
+// madvise and keeps normal pages if neither is available
+bool allocate_hash_table(uint64_t num_slots, bool huge_pages) {
+    free_hash_table();
+
+    size_t bytes = num_slots * sizeof(tt_slot);
+    size_t mapped = (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+    void *mem = MAP_FAILED;
+    if (huge_pages) {
+        mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hash_table_pages = "hugetlb";
+    }
+
+    char *start = (char *)mem;
+    if (mem == MAP_FAILED) {
+        // extra room to start the table on a huge page boundary
+        mapped = bytes + (huge_pages ? huge_page_size : 0);
+        mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            cerr << "could not allocate a " << bytes << " byte transposition table" << endl;
+            return false;
+        }
+
+        start = (char *)mem;
+        hash_table_pages = "normal pages";
+        if (huge_pages) {
+            start = (char *)(((uintptr_t)mem + huge_page_size - 1) & ~(uintptr_t)(huge_page_size - 1));
+            if (!madvise(start, bytes, MADV_HUGEPAGE))
+                hash_table_pages = "transparent huge pages";
+        }
+    }
+
+    hash_table_mapping = mem;
+    hash_table_mapping_bytes = mapped;
+    hash_table = (tt_slot *)start;
+    hash_size = num_slots - 1;
+    return true;
+}
 
 void clear_hash_table() {
-    for (int i = 0; i < hash_size; ++i) {
-        hash_table[i].hash_key = 0ULL;
-        hash_table[i].depth = 0u;
-        hash_table[i].flag = 0u;
-        hash_table[i].value = 0;
+    for (uint64_t i = 0; i <= hash_size; ++i) {
+        hash_table[i].key.store(0ULL, memory_order_relaxed);
+        hash_table[i].data.store(0ULL, memory_order_relaxed);
     }
 }
 
-tt read_hash_entry() {
-    return hash_table[hash_key & hash_size];
+tt read_hash_entry(uint64_t key) {
+    tt_slot *slot = &hash_table[key & hash_size];
+    uint64_t data = slot->data.load(memory_order_relaxed);
+
+    tt entry;
+    entry.hash_key = slot->key.load(memory_order_relaxed) ^ data;
+    // an empty slot should never match a key
+    if (!(data & hash_entry_used))
+        entry.hash_key = ~key;
+    entry.depth = data & 0xffff;
+    entry.flag = (data >> 16) & 0xff;
+    entry.value = int32_t(data >> 32);
+    return entry;
 }
 
-void write_hash_entry(uint16_t depth, uint16_t hash_flag, int value) {
+void write_hash_entry(uint64_t hash_key, uint16_t depth, uint16_t hash_flag, int value) {
     // if the hash size is of power 2^n - 1 we can use the and operator instead of modulus
-    tt *hash_entry = &hash_table[hash_key & hash_size];
+    tt_slot *slot = &hash_table[hash_key & hash_size];
+
+    uint64_t data = uint64_t(uint32_t(value)) << 32 | hash_entry_used | uint64_t(hash_flag) << 16 | depth;
+    slot->key.store(hash_key ^ data, memory_order_relaxed);
+    slot->data.store(data, memory_order_relaxed);
+}
+
+// snapshots keep the exact entries of the table so a new process doesn't have to search them again
+// the header has to match this build ( board size and zobrist keys ) and the heuristic
+// weights, which scored the entries of depth limited searches, or the file is rejected
+static constexpr char snapshot_magic[8] = {'T', 'T', 'T', 'S', 'N', 'A', 'P', '\0'};
+static constexpr uint32_t snapshot_version = 3;
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint16_t board_width;
+    uint16_t board_height;
+    uint64_t zobrist_seed;
+    // catches keys generated differently from the same seed
+    uint64_t keys_check;
+    // weights of lines with one and two markers
+    int32_t heuristic_weights[2];
+    uint64_t num_entries;
+};
+
+// 12 bytes per entry
+#pragma pack(push, 1)
+struct snapshot_entry {
+    uint64_t hash_key;
+    int16_t value;
+    // moves searched below the entry
+    uint16_t depth;
+};
+#pragma pack(pop)
+
+constexpr uint64_t marker_keys_check() {
+    uint64_t check = 0ULL;
+    for (int i = 0; i < 2; ++i)
+        for (int j = 0; j < 9; ++j)
+            check = (check * 31) ^ marker_keys[i][j];
+    return check;
+}
+
+snapshot_header make_snapshot_header(uint64_t num_entries) {
+    snapshot_header header{};
+    for (int i = 0; i < 8; ++i)
+        header.magic[i] = snapshot_magic[i];
+    header.version = snapshot_version;
+    header.board_width = 3;
+    header.board_height = 3;
+    header.zobrist_seed = zobrist_seed;
+    header.keys_check = marker_keys_check();
+    header.heuristic_weights[0] = heuristic_weights[1];
+    header.heuristic_weights[1] = heuristic_weights[2];
+    header.num_entries = num_entries;
+    return header;
+}
+
+bool save_hash_table(const char *path) {
+    vector<snapshot_entry> entries;
+    for (uint64_t i = 0; i <= hash_size; ++i) {
+        uint64_t data = hash_table[i].data.load(memory_order_relaxed);
+        if (!(data & hash_entry_used))
+            continue;
+
+        tt entry = read_hash_entry(hash_table[i].key.load(memory_order_relaxed) ^ data);
+        if (entry.flag == hash_flag_exact)
+            entries.push_back({entry.hash_key, int16_t(entry.value), entry.depth});
+    }
 
-    hash_entry->hash_key = hash_key;
-    hash_entry->depth = depth;
-    hash_entry->flag = hash_flag;
-    hash_entry->value = value;
+    ofstream file(path, ios::binary | ios::trunc);
+    snapshot_header header = make_snapshot_header(entries.size());
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)entries.data(), entries.size() * sizeof(snapshot_entry));
+    if (!file) {
+        cerr << "could not write snapshot " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// adds the snapshot's entries to the table, nothing is loaded from a stale or broken file
+bool load_hash_table(const char *path) {
+    ifstream file(path, ios::binary);
+    if (!file)
+        return false;
+
+    snapshot_header header;
+    snapshot_header expected = make_snapshot_header(0);
+    file.read((char *)&header, sizeof(header));
+    if (!file || memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) || header.version != expected.version) {
+        cerr << "rejected snapshot " << path << ": not a snapshot of this version" << endl;
+        return false;
+    }
+    if (header.board_width != expected.board_width || header.board_height != expected.board_height) {
+        cerr << "rejected snapshot " << path << ": board is " << header.board_width << "x" << header.board_height << endl;
+        return false;
+    }
+    if (header.zobrist_seed != expected.zobrist_seed || header.keys_check != expected.keys_check) {
+        cerr << "rejected snapshot " << path << ": different zobrist keys" << endl;
+        return false;
+    }
+    if (header.heuristic_weights[0] != expected.heuristic_weights[0] || header.heuristic_weights[1] != expected.heuristic_weights[1]) {
+        cerr << "rejected snapshot " << path << ": saved with heuristic weights " << header.heuristic_weights[0] << " " << header.heuristic_weights[1] << endl;
+        return false;
+    }
+
+    // the entries have to fill the rest of the file exactly, checked before allocating them
+    file.seekg(0, ios::end);
+    uint64_t entry_bytes = uint64_t(file.tellg()) - sizeof(header);
+    file.seekg(sizeof(header));
+    if (!file || header.num_entries > entry_bytes / sizeof(snapshot_entry)) {
+        cerr << "rejected snapshot " << path << ": file is truncated" << endl;
+        return false;
+    }
+    if (header.num_entries * sizeof(snapshot_entry) != entry_bytes) {
+        cerr << "rejected snapshot " << path << ": trailing bytes after the entries" << endl;
+        return false;
+    }
+
+    vector<snapshot_entry> entries(header.num_entries);
+    file.read((char *)entries.data(), entries.size() * sizeof(snapshot_entry));
+    if (!file) {
+        cerr << "rejected snapshot " << path << ": file is truncated" << endl;
+        return false;
+    }
+
+    for (const snapshot_entry &entry : entries)
+        write_hash_entry(entry.hash_key, entry.depth, hash_flag_exact, entry.value);
+    return true;
 }
 
 // this function checks individual player win positions and converts it to numerical values
 int evaluate(uint16_t player, uint16_t agent, uint16_t depth) {
     for (uint16_t pattern : WINNING_PATTERNS) {
         if ((player & pattern) == pattern) 
-            return -10 + depth;
+            return -WIN_SCORE + depth;
         else if ((agent & pattern) == pattern)
-            return 10 - depth;
+            return WIN_SCORE - depth;
     }
     return 0;
 }
@@ -129,45 +470,215 @@ constexpr bool is_draw(uint16_t board) {
     return (board & FULL_BOARD) == FULL_BOARD;
 }
 
-// marker is used for the tt, between 0 player and 1 agent 
-int negamax(uint16_t player, uint16_t agent, uint16_t depth, int alpha, int beta, bool marker) {
+// counted per thread so benchmarks can report nodes
+thread_local uint64_t nodes_searched = 0;
+
+// prefetch the tt slot of a child before searching it, the first child while the node
+// probes its own slot and every other one while its older sibling is searched
+// the benchmark turns this off to measure what it saves
+bool prefetch_children = true;
+
+// set to abandon running searches ( pondering ), a stopped search returns
+// garbage and doesn't write anything to the tt
+atomic<bool> stop_search(false);
+
+// search tracing records one event per negamax node into a ring buffer per thread
+// ( only the owning thread writes it so no locks ) and --trace dumps every buffer at exit
+// build with -DNO_SEARCH_TRACE to compile it out, compiled in it costs one predictable
+// branch per node while it is off
+enum trace_tt_outcome : uint8_t {
+    trace_tt_miss, trace_tt_hit, trace_tt_bound, trace_tt_shallow
+};
+
+enum trace_result : uint8_t {
+    trace_searched, trace_cutoff, trace_from_tt, trace_terminal, trace_leaf, trace_stopped
+};
+
+// 24 bytes, the same layout is read by trace.cpp
+struct trace_event {
+    uint64_t hash_key;
+    // the window the node was called with
+    int32_t alpha;
+    int32_t beta;
+    int32_t value;
+    uint8_t depth;
+    uint8_t tt_outcome;
+    uint8_t result;
+    uint8_t marker;
+};
+static_assert(sizeof(trace_event) == 24, "trace_event has to match trace.cpp");
+
+static constexpr char trace_magic[8] = {'T', 'T', 'T', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t trace_version = 1;
+
+// 2 ^ n so the index wraps with an and, the oldest events get overwritten
+static constexpr uint64_t trace_capacity = 1 << 20;
+
+struct trace_buffer {
+    uint32_t thread_index;
+    // events ever recorded, the last trace_capacity of them are kept
+    uint64_t count;
+    vector<trace_event> events;
+};
+
+bool trace_enabled = false;
+
+// every buffer ever handed out, kept after its thread exits so it can still be dumped
+vector<unique_ptr<trace_buffer>> trace_buffers;
+// buffers of threads that exited, the next new thread ( a ponder search ) carries on in one
+// of them instead of allocating another
+vector<trace_buffer *> free_trace_buffers;
+mutex trace_buffers_mutex;
+
+// only the first event of a thread takes the lock
+trace_buffer *acquire_trace_buffer() {
+    lock_guard<mutex> lock(trace_buffers_mutex);
+    if (!free_trace_buffers.empty()) {
+        trace_buffer *buffer = free_trace_buffers.back();
+        free_trace_buffers.pop_back();
+        return buffer;
+    }
+    trace_buffers.emplace_back(new trace_buffer{uint32_t(trace_buffers.size()), 0, vector<trace_event>(trace_capacity)});
+    return trace_buffers.back().get();
+}
+
+// gives the buffer back when its thread exits
+struct thread_trace_handle {
+    trace_buffer *buffer = nullptr;
+    ~thread_trace_handle() {
+        if (!buffer)
+            return;
+        lock_guard<mutex> lock(trace_buffers_mutex);
+        free_trace_buffers.push_back(buffer);
+    }
+};
+
+thread_local thread_trace_handle thread_trace;
+
+void trace_node(const position &pos, uint16_t depth, int alpha, int beta, int value, uint8_t tt_outcome, uint8_t result) {
+    trace_buffer *buffer = thread_trace.buffer;
+    if (!buffer)
+        buffer = thread_trace.buffer = acquire_trace_buffer();
+    trace_event &event = buffer->events[buffer->count++ & (trace_capacity - 1)];
+    event = {pos.hash_key, alpha, beta, value, uint8_t(depth), tt_outcome, result, pos.marker};
+}
+
+#ifndef NO_SEARCH_TRACE
+#define TRACE_NODE(value, result) \
+    do { \
+        if (trace_enabled) \
+            trace_node(pos, depth, alpha_orig, beta_orig, value, tt_outcome, result); \
+    } while (0)
+#else
+#define TRACE_NODE(value, result) do {} while (0)
+#endif
+
+// header, then for every thread its index, event count, events kept and the events oldest first
+bool dump_trace(const char *path) {
+    ofstream file(path, ios::binary | ios::trunc);
+    uint32_t num_threads = trace_buffers.size();
+    file.write(trace_magic, sizeof(trace_magic));
+    file.write((const char *)&trace_version, sizeof(trace_version));
+    file.write((const char *)&num_threads, sizeof(num_threads));
+
+    for (const unique_ptr<trace_buffer> &buffer : trace_buffers) {
+        uint64_t kept = min(buffer->count, trace_capacity);
+        file.write((const char *)&buffer->thread_index, sizeof(buffer->thread_index));
+        file.write((const char *)&buffer->count, sizeof(buffer->count));
+        file.write((const char *)&kept, sizeof(kept));
+        for (uint64_t i = buffer->count - kept; i < buffer->count; ++i)
+            file.write((const char *)&buffer->events[i & (trace_capacity - 1)], sizeof(trace_event));
+    }
+    if (!file) {
+        cerr << "could not write trace " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+void clear_trace() {
+    lock_guard<mutex> lock(trace_buffers_mutex);
+    for (unique_ptr<trace_buffer> &buffer : trace_buffers)
+        buffer->count = 0;
+}
+
+// positions with this many markers are scored with the heuristic instead of searched
+// 9 searches every game to the end
+thread_local uint16_t search_depth_limit = 9;
+
+// searches from the point of view of pos.marker, the side to move
+// depth is the number of markers on the board so scores don't depend on where the search started
+// tt entries keep how many moves were searched below them so a depth limited search
+// never stands in for a deeper one
+int negamax(position &pos, uint16_t depth, int alpha, int beta) {
     int alpha_orig = alpha;
+    // only read by TRACE_NODE
+    [[maybe_unused]] int beta_orig = beta;
+    [[maybe_unused]] uint8_t tt_outcome = trace_tt_miss;
+    ++nodes_searched;
+
+    // the first child's slot loads while this node probes its own
+    uint16_t board = pos.open_squares();
+    if (prefetch_children && board)
+        __builtin_prefetch(&hash_table[(pos.hash_key ^ marker_keys[pos.marker][__builtin_ctz(board)]) & hash_size]);
 
     // see if this position is in the transposition table 
-    // tt entry = read_hash_entry();
-    tt entry = hash_table[hash_key & hash_size];
-    if (entry.hash_key == hash_key && entry.depth >= depth) {
-        if (entry.flag == hash_flag_exact)
+    tt entry = read_hash_entry(pos.hash_key);
+    if (entry.hash_key == pos.hash_key && entry.depth >= search_depth_limit - depth) {
+        tt_outcome = trace_tt_hit;
+        if (entry.flag == hash_flag_exact) {
+            TRACE_NODE(entry.value, trace_from_tt);
             return entry.value;
+        }
         else if (entry.flag == hash_flag_alpha)
             alpha = max(alpha, entry.value);
         else if (entry.flag == hash_flag_beta) 
             beta = min(beta, entry.value);
 
-        if (alpha >= beta)
+        if (alpha >= beta) {
+            TRACE_NODE(entry.value, trace_from_tt);
             return entry.value;
+        }
+        tt_outcome = trace_tt_bound;
     }
+    else if (entry.hash_key == pos.hash_key)
+        tt_outcome = trace_tt_shallow;
 
-    int score = evaluate(player, agent, depth);
+    // the side that just moved is the only one that can have won
+    int score = evaluate(pos.boards[!pos.marker], pos.boards[pos.marker], depth);
 
-    if (score)
+    if (score) {
+        TRACE_NODE(score, trace_terminal);
         return score;
-    else if (is_draw(player | agent))
+    }
+    else if (is_draw(pos.markers())) {
+        TRACE_NODE(0, trace_terminal);
         return 0;
+    }
+    else if (depth >= search_depth_limit) {
+        int heuristic = incremental_heuristic ? pos.heuristic : evaluate_heuristic(pos.boards[0], pos.boards[1]);
+        TRACE_NODE(pos.marker ? heuristic : -heuristic, trace_leaf);
+        return pos.marker ? heuristic : -heuristic;
+    }
 
-    int value = INT32_MIN;
+    // INT32_MIN can't be negated so the window is kept symmetric
+    int value = -INT32_MAX;
     // go through open positions 
-    uint16_t board = (~(player | agent)) ^ OUT_OF_BOUNDS;
     while (board) {
         uint16_t choice = __builtin_ctz(board);
         board ^= 1u << choice;
-        agent |= 1u << choice;
-        hash_key ^= marker_keys[marker][choice];
-        // have to swap the boards 
-        value = max(value, -negamax(agent, player, depth + 1, -beta, -alpha, !marker));
+        // start loading the next child's tt slot while this child is searched
+        if (prefetch_children && board)
+            __builtin_prefetch(&hash_table[(pos.hash_key ^ marker_keys[pos.marker][__builtin_ctz(board)]) & hash_size]);
+        pos.make_move(choice);
+        value = max(value, -negamax(pos, depth + 1, -beta, -alpha));
         // undo move / hash
-        agent ^= 1u << choice;
-        hash_key ^= marker_keys[marker][choice];
+        pos.unmake_move(choice);
+
+        if (stop_search.load(memory_order_relaxed)) {
+            TRACE_NODE(0, trace_stopped);
+            return 0;
+        }
 
         alpha = max(alpha, value);
         if (alpha >= beta)
@@ -183,18 +694,20 @@ int negamax(uint16_t player, uint16_t agent, uint16_t depth, int alpha, int beta
     else
         entry.flag = hash_flag_exact;
 
-    entry.depth = depth;
+    entry.depth = search_depth_limit - depth;
 
-    write_hash_entry(entry.depth, entry.flag, entry.value);
+    write_hash_entry(pos.hash_key, entry.depth, entry.flag, entry.value);
+    TRACE_NODE(value, value >= beta ? trace_cutoff : trace_searched);
     return value;
 }
 
-uint16_t find_best_move(uint16_t player, uint16_t agent) {
-    int best_val = INT32_MIN;
-    uint16_t best_move;
+// every root move is searched with a full window so best_val is exact
+uint16_t find_best_move(position pos, int &best_val) {
+    best_val = INT32_MIN;
+    uint16_t best_move = 0;
 
     // board represents the positions where there is an open slot
-    uint16_t board = (~(player | agent)) ^ OUT_OF_BOUNDS;
+    uint16_t board = pos.open_squares();
     while (board) {
         // get the index of an open position
         uint16_t choice = __builtin_ctz(board);
@@ -202,14 +715,12 @@ uint16_t find_best_move(uint16_t player, uint16_t agent) {
         board ^= 1u << choice;
 
         // play the index 
-        agent |= 1u << choice;
-        hash_key ^= marker_keys[1][choice];
+        pos.make_move(choice);
 
-        int move_val = -negamax(agent, player, 0, INT32_MIN, INT32_MAX, false);
+        int move_val = -negamax(pos, __builtin_popcount(pos.markers()), -INT32_MAX, INT32_MAX);
 
         // undo the move / hash
-        agent ^= 1u << choice;
-        hash_key ^= marker_keys[1][choice];
+        pos.unmake_move(choice);
 
         if (move_val > best_val) {
             best_move = choice;
@@ -219,6 +730,97 @@ uint16_t find_best_move(uint16_t player, uint16_t agent) {
     return best_move;
 }
 
+// iterative deepening until time_budget is used up, the deepest search that finished picks the move
+// a search that was started always finishes so the budget can be overrun by the last one
+uint16_t find_best_move_timed(position pos, chrono::nanoseconds time_budget) {
+    chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+    int best_val;
+    uint16_t best_move = 0;
+
+    pos.heuristic = evaluate_heuristic(pos.boards[0], pos.boards[1]);
+    incremental_heuristic = true;
+    for (search_depth_limit = __builtin_popcount(pos.markers()) + 1; search_depth_limit <= 9; ++search_depth_limit) {
+        best_move = find_best_move(pos, best_val);
+        if (chrono::steady_clock::now() - start >= time_budget)
+            break;
+    }
+    search_depth_limit = 9;
+    incremental_heuristic = false;
+    return best_move;
+}
+
+uint16_t find_best_move(position pos) {
+    int best_val;
+    return find_best_move(pos, best_val);
+}
+
+struct move_analysis {
+    uint16_t move;
+    // exact value for the side to move
+    int value;
+    // starts with move
+    vector<uint16_t> pv;
+};
+
+// exact value of a position with a full window, mostly tt hits once the root moves are searched
+int search_exact(position &pos) {
+    return negamax(pos, __builtin_popcount(pos.markers()), -INT32_MAX, INT32_MAX);
+}
+
+// follows moves whose child value matches until the game ends
+// value is the exact value of pos for the side to move
+void principal_variation(position pos, int value, vector<uint16_t> &pv) {
+    bool found = true;
+    while (found && !evaluate(pos.boards[!pos.marker], pos.boards[pos.marker], 0) && !is_draw(pos.markers())) {
+        found = false;
+        uint16_t board = pos.open_squares();
+        while (board && !found) {
+            uint16_t choice = __builtin_ctz(board);
+            board ^= 1u << choice;
+
+            pos.make_move(choice);
+            int child_val = search_exact(pos);
+            found = -child_val == value;
+            if (found) {
+                pv.push_back(choice);
+                value = child_val;
+            }
+            else
+                pos.unmake_move(choice);
+        }
+    }
+}
+
+// exact scores for the best k moves ( every move when k is 0 ) sorted best first
+// the root moves share the tt so each subtree is only searched once
+vector<move_analysis> analyze(position pos, int k) {
+    vector<move_analysis> moves;
+
+    uint16_t board = pos.open_squares();
+    while (board) {
+        uint16_t choice = __builtin_ctz(board);
+        board ^= 1u << choice;
+
+        pos.make_move(choice);
+        moves.push_back({choice, -search_exact(pos), {}});
+        pos.unmake_move(choice);
+    }
+
+    stable_sort(moves.begin(), moves.end(), [](const move_analysis &a, const move_analysis &b) {
+        return a.value > b.value;
+    });
+    if (k > 0 && k < int(moves.size()))
+        moves.resize(k);
+
+    for (move_analysis &m : moves) {
+        m.pv.push_back(m.move);
+        pos.make_move(m.move);
+        principal_variation(pos, -m.value, m.pv);
+        pos.unmake_move(m.move);
+    }
+    return moves;
+}
+
 void print_board(uint16_t x_board, uint16_t o_board) {
     uint16_t idx;
     for (int i = 2; i >= 0; i--) {
@@ -235,19 +837,68 @@ void print_board(uint16_t x_board, uint16_t o_board) {
     }
 }
 
-void play_game(bool human_goes_first) {
-    uint16_t player = 0u;
-    uint16_t agent = 0u;
+// searches the agent's answer to every move the human could make while they think
+// the predicted move goes first since that is the one most likely to be played
+// replies[move] is the agent's answer to move, or -1 if that search didn't finish
+void ponder(position pos, int16_t *replies) {
+    int predicted_val;
+    uint16_t predicted = find_best_move(pos, predicted_val);
+
+    uint16_t board = pos.open_squares() ^ (1u << predicted);
+    uint16_t choice = predicted;
+    while (!stop_search.load(memory_order_relaxed)) {
+        pos.make_move(choice);
+        // nothing to answer if the human's move ends the game
+        if (!evaluate(pos.boards[0], pos.boards[1], 0) && !is_draw(pos.markers())) {
+            int best_val;
+            uint16_t best_move = find_best_move(pos, best_val);
+            if (!stop_search.load(memory_order_relaxed))
+                replies[choice] = best_move;
+        }
+        pos.unmake_move(choice);
+
+        if (!board)
+            break;
+        choice = __builtin_ctz(board);
+        board ^= 1u << choice;
+    }
+}
+
+struct ponder_state {
+    thread worker;
+    int16_t replies[9];
+};
+
+void start_pondering(ponder_state &ponder_search, const position &pos) {
+    fill(begin(ponder_search.replies), end(ponder_search.replies), -1);
+    stop_search = false;
+    ponder_search.worker = thread(ponder, pos, ponder_search.replies);
+}
+
+// returns the pondered answer to move or -1 on a ponder miss
+int16_t stop_pondering(ponder_state &ponder_search, uint16_t move) {
+    stop_search = true;
+    ponder_search.worker.join();
+    stop_search = false;
+    return move < 9 ? ponder_search.replies[move] : -1;
+}
+
+// a move_time above 0 makes the agent search by iterative deepening for about that long
+void play_game(bool human_goes_first, bool pondering, chrono::nanoseconds move_time) {
+    // 0 is player ; 1 is agent 
+    position pos = make_position(0u, 0u, !human_goes_first);
 
     uint16_t move;
     uint16_t ai_move;
+    ponder_state ponder_search;
+    int16_t pondered_move = -1;
     
     cout << "Game starting" << endl;
 
     if (human_goes_first)
-        print_board(player, agent);
+        print_board(pos.boards[0], pos.boards[1]);
     else
-        print_board(agent, player);
+        print_board(pos.boards[1], pos.boards[0]);
     
     // keep track of whose turn it is 
     bool player_turn = human_goes_first;
@@ -257,59 +908,829 @@ void play_game(bool human_goes_first) {
     while(true) {
         if (player_turn) {
             cout << "Choose an index to play" << endl;
+            if (pondering)
+                start_pondering(ponder_search, pos);
             cin >> move;
-            player |= 1u << move;
-            hash_key ^= marker_keys[0][move];
+            // the latency the human sees starts once they have moved
+            start = chrono::steady_clock::now();
+            if (pondering)
+                pondered_move = stop_pondering(ponder_search, move);
+            pos.make_move(move);
         }
         else {
-            start = chrono::steady_clock::now();
-            ai_move = find_best_move(player, agent);
+            if (!pos.markers())
+                start = chrono::steady_clock::now();
+            if (pondered_move >= 0) {
+                ai_move = pondered_move;
+                cout << "Ponder hit" << endl;
+            }
+            else if (move_time.count())
+                ai_move = find_best_move_timed(pos, move_time);
+            else
+                ai_move = find_best_move(pos);
             end = chrono::steady_clock::now();
 
             double elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
 
-            cout << "Search time nanoseconds: " << elapsed_time << endl;
-            cout << fixed << "Search time seconds: " << elapsed_time / 1e9 << endl;
+            cout << "Move latency nanoseconds: " << elapsed_time << endl;
+            cout << fixed << "Move latency seconds: " << elapsed_time / 1e9 << endl;
             
             cout << "Agent played at index " << ai_move << endl;
             cout << endl;
 
-            agent |= 1u << ai_move;
-            hash_key ^= marker_keys[1][ai_move];
+            pos.make_move(ai_move);
         }
         player_turn = !player_turn;
         
         // seeing which to give X and O to 
         if (human_goes_first)
-            print_board(player, agent);
+            print_board(pos.boards[0], pos.boards[1]);
         else
-            print_board(agent, player);
+            print_board(pos.boards[1], pos.boards[0]);
 
-        int value = evaluate(player, agent, 0);
+        int value = evaluate(pos.boards[0], pos.boards[1], 0);
 
         // terminal conditions 
-        if (value == -10) {
+        if (value == -WIN_SCORE) {
             cout << "Player wins" << endl;
             break;
         }
-        else if (value == 10) {
+        else if (value == WIN_SCORE) {
             cout << "Agent wins" << endl;
             break;
         }
-        else if (is_draw(player | agent)) {
+        else if (is_draw(pos.markers())) {
             cout << "Game is drawn" << endl;
             break;
         }
     }
 }
 
-int main() {
-    init_random_keys();
-    clear_hash_table();
-    // hash_key = generate_hash_key();
+// game records are one game per line, each move is a square index 0-8 as shown by print_board
+// X always moves first, anything that isn't a digit is skipped
+// every move is written back as move:best:value where value is the exact score of the
+// move that was played for the side that played it, a trailing ? marks a blunder
+// ( a move that turns a win into a draw / loss or a draw into a loss )
+// returns the number of moves annotated
+int annotate_game(const char *line, const char *line_end, string &out) {
+    // 0 is O ; 1 is X
+    position pos = make_position(0u, 0u, true);
+
+    int moves = 0;
+    for (const char *c = line; c < line_end; ++c) {
+        if (*c < '0' || *c > '9')
+            continue;
+
+        if (moves)
+            out += ' ';
+
+        uint16_t move = *c - '0';
+
+        // the game has to still be going and the square has to be open
+        if (move > 8 || !(pos.open_squares() >> move & 1u) || evaluate(pos.boards[0], pos.boards[1], 0) || is_draw(pos.markers())) {
+            out += '!';
+            break;
+        }
+
+        int best_val;
+        uint16_t best_move = find_best_move(pos, best_val);
+
+        // the root search just wrote this child so it should come straight out of the tt
+        pos.make_move(move);
+        int move_val = -negamax(pos, __builtin_popcount(pos.markers()), -INT32_MAX, INT32_MAX);
+
+        out += char('0' + move);
+        out += ':';
+        out += char('0' + best_move);
+        out += ':';
+        out += to_string(move_val);
+        if ((move_val > 0) - (move_val < 0) < (best_val > 0) - (best_val < 0))
+            out += '?';
+
+        ++moves;
+    }
+    out += '\n';
+    return moves;
+}
+
+// the file is mapped and cut into chunks on line boundaries, workers grab chunks in order
+// and the main thread writes each chunk as soon as it and every chunk before it is done
+// so the output keeps the order of the input without holding all of it in memory
+int analyze_file(const char *path, unsigned num_threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        cerr << "could not open " << path << endl;
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        cerr << "could not stat " << path << endl;
+        close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+
+    const char *data = nullptr;
+    if (size) {
+        data = (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            cerr << "could not map " << path << endl;
+            close(fd);
+            return 1;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+
+    // about 1mb per chunk, always ending right after a newline
+    const size_t chunk_size = 1 << 20;
+    vector<size_t> bounds = {0};
+    while (bounds.back() < size) {
+        size_t end = min(bounds.back() + chunk_size, size);
+        while (end < size && data[end - 1] != '\n')
+            ++end;
+        bounds.push_back(end);
+    }
+    size_t num_chunks = bounds.size() - 1;
+
+    vector<string> results(num_chunks);
+    vector<char> done(num_chunks, 0);
+    atomic<size_t> next_chunk(0);
+    atomic<uint64_t> total_moves(0);
+    atomic<uint64_t> total_games(0);
+    mutex done_mutex;
+    condition_variable done_cv;
+
+    chrono::time_point<chrono::steady_clock> start, end;
+    start = chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        size_t chunk;
+        while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+            string out;
+            uint64_t moves = 0;
+            uint64_t games = 0;
+
+            const char *line = data + bounds[chunk];
+            const char *chunk_end = data + bounds[chunk + 1];
+            while (line < chunk_end) {
+                const char *line_end = line;
+                while (line_end < chunk_end && *line_end != '\n')
+                    ++line_end;
+
+                moves += annotate_game(line, line_end, out);
+                ++games;
+
+                line = line_end + 1;
+            }
+            total_moves += moves;
+            total_games += games;
+
+            lock_guard<mutex> lock(done_mutex);
+            results[chunk].swap(out);
+            done[chunk] = 1;
+            done_cv.notify_one();
+        }
+    };
+
+    // the loop below waits on the workers, so there has to be at least one
+    num_threads = max(1u, num_threads);
+    vector<thread> workers;
+    for (unsigned i = 0; i < num_threads; ++i)
+        workers.emplace_back(worker);
+
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+        string out;
+        {
+            unique_lock<mutex> lock(done_mutex);
+            done_cv.wait(lock, [&]() { return done[chunk] != 0; });
+            out.swap(results[chunk]);
+        }
+        cout.write(out.data(), out.size());
+    }
+    cout.flush();
+
+    for (thread &t : workers)
+        t.join();
+
+    end = chrono::steady_clock::now();
+    double elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+
+    cerr << "Games analyzed: " << total_games << endl;
+    cerr << "Moves analyzed: " << total_moves << endl;
+    cerr << "Threads: " << num_threads << endl;
+    cerr << fixed << "Analysis time seconds: " << elapsed_time / 1e9 << endl;
+    cerr << fixed << "Moves per second: " << total_moves / (elapsed_time / 1e9) << endl;
+
+    if (size)
+        munmap((void *)data, size);
+    close(fd);
+    return 0;
+}
+
+// writes random legal games in the format analyze_file reads
+void generate_games(uint64_t num_games, uint64_t seed) {
+    mt19937_64 gen(seed);
+    string out;
+
+    for (uint64_t i = 0; i < num_games; ++i) {
+        position pos = make_position(0u, 0u, true);
+
+        while (!evaluate(pos.boards[0], pos.boards[1], 0) && !is_draw(pos.markers())) {
+            uint16_t board = pos.open_squares();
+            // pick a random open square by dropping a random number of lsbs
+            for (int skip = gen() % __builtin_popcount(board); skip; --skip)
+                board &= board - 1;
+            uint16_t choice = __builtin_ctz(board);
+
+            pos.make_move(choice);
+            out += char('0' + choice);
+        }
+        out += '\n';
 
-    bool human_goes_first = false;
-    play_game(human_goes_first);
+        if (out.size() >= (1 << 20)) {
+            cout.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+    cout.write(out.data(), out.size());
+    cout.flush();
+}
+
+// plays square indices from the empty board, X ( 1 ) moves first
+// ok is false if a move is not legal
+position position_from_moves(const string &moves, bool &ok) {
+    position pos = make_position(0u, 0u, true);
+    ok = true;
+    for (char c : moves) {
+        uint16_t move = c - '0';
+        if (move > 8 || !(pos.open_squares() >> move & 1u) || evaluate(pos.boards[0], pos.boards[1], 0)) {
+            ok = false;
+            break;
+        }
+        pos.make_move(move);
+    }
+    return pos;
+}
+
+// prints every move with its exact score and principal variation
+int print_hint(const string &moves, int k) {
+    bool ok;
+    position pos = position_from_moves(moves, ok);
+    // position_from_moves only rejects moves played after a win, not a game that ends on its last move
+    if (!ok || evaluate(pos.boards[0], pos.boards[1], 0) || is_draw(pos.markers())) {
+        cerr << "illegal game " << moves << endl;
+        return 1;
+    }
 
+    for (const move_analysis &m : analyze(pos, k)) {
+        cout << m.move << " " << m.value << " pv";
+        for (uint16_t move : m.pv)
+            cout << " " << move;
+        cout << endl;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// openings the benchmark searches from
+static const char *bench_openings[] = {
+    "", "4", "0", "1", "40", "04", "01", "48", "402", "0481"
+};
+
+static constexpr int bench_iterations = 200;
+
+// hardware counters around the searches of the benchmark, read through perf_event_open
+// only user space is counted so this works with the default perf_event_paranoid of 2
+enum perf_event_index {
+    perf_cycles, perf_instructions, perf_l1d_misses, perf_llc_misses, perf_branch_misses, num_perf_events
+};
+
+static const char *perf_event_names[] = {
+    "cycles", "instructions", "L1d misses", "LLC misses", "branch misses"
+};
+
+struct perf_counters {
+    // -1 for counters the kernel / cpu doesn't have
+    int fds[num_perf_events];
+    // the first counter that opened, the others are in its group
+    int leader;
+    uint64_t totals[num_perf_events];
+    // when the pmu can't fit the whole group the kernel multiplexes it and a counter
+    // only runs part of the time it is enabled, or not at all
+    uint64_t time_enabled[num_perf_events];
+    uint64_t time_running[num_perf_events];
+};
+
+// leader is -1 when no counter could be opened, every call is then a no-op
+perf_counters search_counters = {{-1, -1, -1, -1, -1}, -1, {}, {}, {}};
+
+int open_perf_event(uint32_t type, uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// returns false with the reason in error if no counter is available
+bool open_perf_counters(perf_counters &counters, string &error) {
+    static constexpr uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    static constexpr pair<uint32_t, uint64_t> events[num_perf_events] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, l1d_read_miss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+    };
+
+    counters.leader = -1;
+    for (int i = 0; i < num_perf_events; ++i) {
+        counters.fds[i] = open_perf_event(events[i].first, events[i].second, counters.leader);
+        if (counters.fds[i] < 0 && error.empty())
+            error = strerror(errno);
+        if (counters.fds[i] >= 0 && counters.leader < 0)
+            counters.leader = counters.fds[i];
+        counters.totals[i] = 0;
+        counters.time_enabled[i] = 0;
+        counters.time_running[i] = 0;
+    }
+    return counters.leader >= 0;
+}
+
+void close_perf_counters(perf_counters &counters) {
+    for (int &fd : counters.fds) {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    counters.leader = -1;
+}
+
+void start_perf_counters(perf_counters &counters) {
+    if (counters.leader < 0)
+        return;
+    ioctl(counters.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void stop_perf_counters(perf_counters &counters) {
+    if (counters.leader < 0)
+        return;
+    ioctl(counters.leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    for (int i = 0; i < num_perf_events; ++i) {
+        // value, time enabled, time running
+        uint64_t values[3];
+        if (counters.fds[i] >= 0 && read(counters.fds[i], values, sizeof(values)) == sizeof(values)) {
+            counters.totals[i] += values[0];
+            counters.time_enabled[i] += values[1];
+            counters.time_running[i] += values[2];
+        }
+    }
+}
+
+// prints the counters per node ( or whatever count is ) since the last call and resets them
+void print_perf_counters(uint64_t count, const char *per = "node") {
+    if (search_counters.leader < 0)
+        return;
+    for (int i = 0; i < num_perf_events; ++i) {
+        uint64_t enabled = search_counters.time_enabled[i];
+        uint64_t running = search_counters.time_running[i];
+        uint64_t total = search_counters.totals[i];
+        search_counters.totals[i] = 0;
+        search_counters.time_enabled[i] = 0;
+        search_counters.time_running[i] = 0;
+        if (search_counters.fds[i] < 0 || !count)
+            continue;
+
+        if (!running)
+            cout << "  " << perf_event_names[i] << ": unavailable, never scheduled on the pmu" << endl;
+        else if (running < enabled)
+            cout << "  " << perf_event_names[i] << " per " << per << ": " << double(total) * enabled / running / count
+                 << " ( scaled, counted " << 100.0 * running / enabled << "% of the time )" << endl;
+        else
+            cout << "  " << perf_event_names[i] << " per " << per << ": " << double(total) / count << endl;
+    }
+}
+
+void print_bench_result(const char *name, double elapsed_time, uint64_t nodes) {
+    cout << name << endl;
+    cout << fixed << "  time per opening seconds: " << elapsed_time / 1e9 / bench_iterations / size(bench_openings) << endl;
+    cout << "  nodes per opening: " << nodes / bench_iterations / size(bench_openings) << endl;
+    print_perf_counters(nodes);
+}
+
+static constexpr int bench_games = 100;
+
+// how long the simulated human thinks before moving
+static constexpr chrono::microseconds bench_think_time(1000);
+
+// plays games against a random human starting from an empty tt and returns the
+// average latency between the human's move and the agent's answer in nanoseconds
+double bench_move_latency(bool pondering, int &hits, int &moves) {
+    chrono::time_point<chrono::steady_clock> start, end;
+    mt19937_64 gen(1);
+    double elapsed_time = 0;
+    hits = 0;
+    moves = 0;
+
+    for (int game = 0; game < bench_games; ++game) {
+        clear_hash_table();
+        // the agent ( 1 ) moves first
+        position pos = make_position(0u, 0u, true);
+        ponder_state ponder_search;
+        int16_t pondered_move = -1;
+
+        while (!evaluate(pos.boards[0], pos.boards[1], 0) && !is_draw(pos.markers())) {
+            if (pos.marker) {
+                // the counters only follow this thread, not the ponder thread
+                start_perf_counters(search_counters);
+                uint16_t ai_move = pondered_move >= 0 ? pondered_move : find_best_move(pos);
+                stop_perf_counters(search_counters);
+                end = chrono::steady_clock::now();
+                // the first move has no human move before it
+                if (pos.markers()) {
+                    elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+                    ++moves;
+                }
+                pos.make_move(ai_move);
+            }
+            else {
+                if (pondering)
+                    start_pondering(ponder_search, pos);
+                this_thread::sleep_for(bench_think_time);
+
+                uint16_t board = pos.open_squares();
+                for (int skip = gen() % __builtin_popcount(board); skip; --skip)
+                    board &= board - 1;
+                uint16_t move = __builtin_ctz(board);
+
+                start = chrono::steady_clock::now();
+                if (pondering) {
+                    pondered_move = stop_pondering(ponder_search, move);
+                    hits += pondered_move >= 0;
+                }
+                pos.make_move(move);
+            }
+        }
+    }
+    return elapsed_time / moves;
+}
+
+// depth limited searches look this many moves ahead
+static constexpr int bench_heuristic_depth = 3;
+
+// time per move for the engines in the heuristic match
+static constexpr chrono::microseconds bench_move_time(10);
+
+// plays heuristic_side with the loaded weights against the other side with every weight at 0
+// returns 1 if the heuristic side won, -1 if it lost and 0 for a draw
+int bench_heuristic_game(const char *opening, bool heuristic_side) {
+    bool ok;
+    position pos = position_from_moves(opening, ok);
+    int weights[4];
+    copy(begin(heuristic_weights), end(heuristic_weights), weights);
+
+    while (!evaluate(pos.boards[0], pos.boards[1], 0) && !is_draw(pos.markers())) {
+        if (pos.marker == heuristic_side)
+            copy(begin(weights), end(weights), heuristic_weights);
+        else
+            fill(begin(heuristic_weights), end(heuristic_weights), 0);
+        update_line_scores();
+
+        clear_hash_table();
+        pos.make_move(find_best_move_timed(pos, bench_move_time));
+    }
+    copy(begin(weights), end(weights), heuristic_weights);
+    update_line_scores();
+
+    int value = evaluate(pos.boards[0], pos.boards[1], 0);
+    return heuristic_side ? (value > 0) - (value < 0) : (value < 0) - (value > 0);
+}
+
+void bench_heuristic() {
+    chrono::time_point<chrono::steady_clock> start, end;
+    bool ok;
+
+    cout << "Heuristic evaluation" << endl;
+
+    // the same depth limited searches keeping the heuristic up to date or recomputing it at every leaf
+    for (bool incremental : {true, false}) {
+        nodes_searched = 0;
+        double elapsed_time = 0;
+        for (int i = 0; i < bench_iterations; ++i) {
+            for (const char *opening : bench_openings) {
+                clear_hash_table();
+                position pos = position_from_moves(opening, ok);
+
+                start = chrono::steady_clock::now();
+                start_perf_counters(search_counters);
+                incremental_heuristic = incremental;
+                search_depth_limit = __builtin_popcount(pos.markers()) + bench_heuristic_depth;
+                find_best_move(pos);
+                search_depth_limit = 9;
+                incremental_heuristic = false;
+                stop_perf_counters(search_counters);
+                end = chrono::steady_clock::now();
+                elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+            }
+        }
+        cout << (incremental ? "incremental" : "full recompute") << endl;
+        cout << fixed << "  nanoseconds per node: " << elapsed_time / nodes_searched << endl;
+        print_perf_counters(nodes_searched);
+    }
+
+    // every two move opening with the heuristic engine on both sides
+    int results[3] = {0, 0, 0};
+    for (int first = 0; first < 9; ++first) {
+        for (int second = 0; second < 9; ++second) {
+            if (first == second)
+                continue;
+
+            char opening[] = {char('0' + first), char('0' + second), '\0'};
+            for (bool heuristic_side : {false, true})
+                ++results[bench_heuristic_game(opening, heuristic_side) + 1];
+        }
+    }
+    cout << "heuristic against blind search at " << bench_move_time.count() << " microseconds per move" << endl;
+    cout << "  wins: " << results[2] << " draws: " << results[1] << " losses: " << results[0] << endl;
+}
+
+static constexpr uint64_t bench_large_hash_slots = 1ULL << 26;
+static constexpr int bench_probes = 10000000;
+
+// a 1gb table where nearly every probe misses the caches and, without huge pages, the tlb
+// each search xors a different salt into the root key so it starts from cold slots
+// without clearing a gigabyte every time
+// returns false if the original table couldn't be allocated again
+bool bench_large_hash_table() {
+    chrono::time_point<chrono::steady_clock> start, end;
+    bool ok;
+
+    // put back afterwards, --tt-mb may have sized it
+    uint64_t hash_slots = hash_size + 1;
+
+    cout << "Large transposition table ( " << (bench_large_hash_slots * sizeof(tt_slot) >> 20) << " mb )" << endl;
+    for (bool huge_pages : {false, true}) {
+        if (!allocate_hash_table(bench_large_hash_slots, huge_pages))
+            break;
+        // fault every page in before timing anything
+        clear_hash_table();
+        cout << hash_table_pages << endl;
+
+        // every probe depends on the one before so the latencies add up
+        uint64_t key = 1ULL;
+        start = chrono::steady_clock::now();
+        start_perf_counters(search_counters);
+        for (int i = 0; i < bench_probes; ++i) {
+            key += hash_table[key & hash_size].data.load(memory_order_relaxed);
+            key = next_random_key(key);
+        }
+        stop_perf_counters(search_counters);
+        end = chrono::steady_clock::now();
+        double elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+        cout << fixed << "  probe latency nanoseconds: " << elapsed_time / bench_probes << endl;
+        print_perf_counters(bench_probes, "probe");
+
+        uint64_t salt = 0ULL;
+        for (bool prefetch : {false, true}) {
+            prefetch_children = prefetch;
+            nodes_searched = 0;
+            start = chrono::steady_clock::now();
+            for (int i = 0; i < bench_iterations; ++i) {
+                for (const char *opening : bench_openings) {
+                    position pos = position_from_moves(opening, ok);
+                    pos.hash_key ^= next_random_key(salt);
+                    start_perf_counters(search_counters);
+                    find_best_move(pos);
+                    stop_perf_counters(search_counters);
+                }
+            }
+            end = chrono::steady_clock::now();
+            elapsed_time = double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+            cout << (prefetch ? "  with" : "  without") << " child prefetch nodes per second: " << nodes_searched / (elapsed_time / 1e9) << endl;
+            print_perf_counters(nodes_searched);
+        }
+    }
+
+    prefetch_children = true;
+    return allocate_hash_table(hash_slots, true);
+}
+
+void bench_search_trace() {
+    chrono::time_point<chrono::steady_clock> start, end;
+    bool ok;
+
+    cout << "Search trace" << endl;
+    // with --trace the events of the benchmark stay in the dump
+    bool traced = trace_enabled;
+
+    // compare the off numbers against negamax_notrace.out to see what compiling it in costs
+    for (bool tracing : {false, true}) {
+        trace_enabled = tracing;
+        nodes_searched = 0;
+        double elapsed_time = 0;
+        for (int i = 0; i < bench_iterations; ++i) {
+            for (const char *opening : bench_openings) {
+                clear_hash_table();
+                start = chrono::steady_clock::now();
+                start_perf_counters(search_counters);
+                find_best_move(position_from_moves(opening, ok));
+                stop_perf_counters(search_counters);
+                end = chrono::steady_clock::now();
+                elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+            }
+        }
+        cout << (tracing ? "tracing on" : "tracing off") << endl;
+        cout << fixed << "  nanoseconds per node: " << elapsed_time / nodes_searched << endl;
+        print_perf_counters(nodes_searched);
+    }
+    trace_enabled = traced;
+    if (!traced)
+        clear_trace();
+}
+
+// every search starts from an empty tt so the runs are comparable
+// clearing the tt is left out of the times
+// profiling adds hardware counters per node to the search results
+// returns false if the benchmark left no transposition table behind
+bool run_bench(bool profiling) {
+    chrono::time_point<chrono::steady_clock> start, end;
+    double elapsed_time;
+    bool ok;
+
+    string perf_error;
+    if (profiling && !open_perf_counters(search_counters, perf_error))
+        cout << "Hardware counters unavailable: " << perf_error << endl;
+
+    cout << "Multi-PV analysis" << endl;
+
+    for (int k : {0, 1}) {
+        // analyze() sharing the tt across the root moves
+        nodes_searched = 0;
+        elapsed_time = 0;
+        for (int i = 0; i < bench_iterations; ++i) {
+            for (const char *opening : bench_openings) {
+                clear_hash_table();
+                start = chrono::steady_clock::now();
+                start_perf_counters(search_counters);
+                analyze(position_from_moves(opening, ok), k);
+                stop_perf_counters(search_counters);
+                end = chrono::steady_clock::now();
+                elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+            }
+        }
+        print_bench_result(k ? "analyze best move with pv, shared tt" : "analyze every move with pv, shared tt", elapsed_time, nodes_searched);
+    }
+
+    // what a hint feature would do with one fresh search per candidate move, no pv
+    nodes_searched = 0;
+    elapsed_time = 0;
+    for (int i = 0; i < bench_iterations; ++i) {
+        for (const char *opening : bench_openings) {
+            position pos = position_from_moves(opening, ok);
+            uint16_t board = pos.open_squares();
+            while (board) {
+                uint16_t choice = __builtin_ctz(board);
+                board ^= 1u << choice;
+
+                clear_hash_table();
+                start = chrono::steady_clock::now();
+                start_perf_counters(search_counters);
+                pos.make_move(choice);
+                search_exact(pos);
+                pos.unmake_move(choice);
+                stop_perf_counters(search_counters);
+                end = chrono::steady_clock::now();
+                elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+            }
+        }
+    }
+    print_bench_result("independent search per move", elapsed_time, nodes_searched);
+
+    cout << "Pondering" << endl;
+    for (bool pondering : {false, true}) {
+        int hits, moves;
+        nodes_searched = 0;
+        double latency = bench_move_latency(pondering, hits, moves);
+        cout << (pondering ? "with pondering" : "without pondering") << endl;
+        cout << fixed << "  move latency seconds: " << latency / 1e9 << endl;
+        cout << "  ponder hits: " << hits << " / " << moves << endl;
+        print_perf_counters(nodes_searched);
+    }
+
+    cout << "Snapshots" << endl;
+    const char *snapshot_file = "negamax_bench.tt";
+    clear_hash_table();
+    analyze(make_position(0u, 0u, true), 0);
+    save_hash_table(snapshot_file);
+
+    // time to first move for a new process, with and without loading a snapshot first
+    for (bool warm : {false, true}) {
+        elapsed_time = 0;
+        nodes_searched = 0;
+        for (int i = 0; i < bench_iterations; ++i) {
+            clear_hash_table();
+            start = chrono::steady_clock::now();
+            start_perf_counters(search_counters);
+            if (warm)
+                load_hash_table(snapshot_file);
+            find_best_move(make_position(0u, 0u, true));
+            stop_perf_counters(search_counters);
+            end = chrono::steady_clock::now();
+            elapsed_time += double(chrono::duration_cast <chrono::nanoseconds> (end - start).count());
+        }
+        cout << (warm ? "warm start, snapshot loaded" : "cold start") << endl;
+        cout << fixed << "  time to first move seconds: " << elapsed_time / 1e9 / bench_iterations << endl;
+        print_perf_counters(nodes_searched);
+    }
+    remove(snapshot_file);
+
+    bench_search_trace();
+    bench_heuristic();
+    bool restored = bench_large_hash_table();
+    close_perf_counters(search_counters);
+    return restored;
+}
+
+int main(int argc, char *argv[]) {
+    // --tt file.tt anywhere loads the table at startup and saves it on the way out
+    // --tt-mb 1024 sizes the table, rounded down to a power of 2 slots
+    // --weights file loads the heuristic weights, --move-time-us 50 limits the agent's search time
+    // --trace file.trace records every searched node and writes them out on the way out
+    vector<string> args;
+    string tt_file;
+    string trace_file;
+    uint64_t hash_slots = default_hash_slots;
+    chrono::nanoseconds move_time(0);
+    update_line_scores();
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--tt" && i + 1 < argc)
+            tt_file = argv[++i];
+        else if (string(argv[i]) == "--trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+            trace_enabled = true;
+        }
+        else if (string(argv[i]) == "--weights" && i + 1 < argc) {
+            if (!load_weights(argv[++i]))
+                return 1;
+        }
+        else if (string(argv[i]) == "--move-time-us" && i + 1 < argc)
+            move_time = chrono::microseconds(stoll(argv[++i]));
+        else if (string(argv[i]) == "--tt-mb" && i + 1 < argc) {
+            uint64_t slots = max<uint64_t>(stoull(argv[++i]) * (1 << 20) / sizeof(tt_slot), 1);
+            hash_slots = 1ULL << (63 - __builtin_clzll(slots));
+        }
+        else
+            args.push_back(argv[i]);
+    }
+    if (!allocate_hash_table(hash_slots, true))
+        return 1;
+    if (!tt_file.empty())
+        load_hash_table(tt_file.c_str());
+
+    string mode = args.size() > 0 ? args[0] : "";
+    int status = 0;
+
+    // ./negamax.out analyze games.txt [threads] > annotated.txt
+    if (mode == "analyze" && args.size() > 1) {
+        unsigned num_threads = args.size() > 2 ? stoul(args[2]) : max(1u, thread::hardware_concurrency());
+        status = analyze_file(args[1].c_str(), num_threads);
+    }
+    // ./negamax.out generate 1000000 [seed] > games.txt
+    else if (mode == "generate" && args.size() > 1) {
+        generate_games(stoull(args[1]), args.size() > 2 ? stoull(args[2]) : 0);
+    }
+    // ./negamax.out hint 40 [k]
+    else if (mode == "hint") {
+        status = print_hint(args.size() > 1 ? args[1] : "", args.size() > 2 ? stoi(args[2]) : 0);
+    }
+    // ./negamax.out snapshot file.tt searches the whole game and saves the table
+    else if (mode == "snapshot" && args.size() > 1) {
+        analyze(make_position(0u, 0u, true), 0);
+        status = save_hash_table(args[1].c_str()) ? 0 : 1;
+    }
+    // ./negamax.out bench [perf]
+    else if (mode == "bench") {
+        // without a table there is nothing to save or search
+        if (!run_bench(args.size() > 1 && args[1] == "perf"))
+            return 1;
+    }
+    else {
+        // ./negamax.out ponder searches during the human's turn
+        bool pondering = mode == "ponder";
+
+        bool human_goes_first = false;
+        play_game(human_goes_first, pondering, move_time);
+    }
+
+    if (!tt_file.empty() && !save_hash_table(tt_file.c_str()))
+        status = 1;
+    if (!trace_file.empty() && !dump_trace(trace_file.c_str()))
+        status = 1;
+    return status;
+}
@@ -0,0 +1,169 @@
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// reads the files negamax.out --trace writes, the layout has to match negamax.cpp
+enum trace_tt_outcome : uint8_t {
+    trace_tt_miss, trace_tt_hit, trace_tt_bound, trace_tt_shallow
+};
+
+enum trace_result : uint8_t {
+    trace_searched, trace_cutoff, trace_from_tt, trace_terminal, trace_leaf, trace_stopped
+};
+
+struct trace_event {
+    uint64_t hash_key;
+    int32_t alpha;
+    int32_t beta;
+    int32_t value;
+    uint8_t depth;
+    uint8_t tt_outcome;
+    uint8_t result;
+    uint8_t marker;
+};
+static_assert(sizeof(trace_event) == 24, "trace_event has to match negamax.cpp");
+
+static constexpr char trace_magic[8] = {'T', 'T', 'T', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t trace_version = 1;
+
+static constexpr const char *tt_outcome_names[] = {"miss", "hit", "bound", "shallow"};
+static constexpr const char *result_names[] = {"searched", "cutoff", "tt", "terminal", "leaf", "stopped"};
+static constexpr int num_tt_outcomes = size(tt_outcome_names);
+static constexpr int num_results = size(result_names);
+
+// a board has 9 squares so nodes are at depth 0 to 9
+static constexpr int max_depth = 10;
+
+struct thread_trace {
+    uint32_t thread_index;
+    // events the thread recorded, only the newest ones are in the file once the ring wrapped
+    uint64_t count;
+    vector<trace_event> events;
+};
+
+bool load_trace(const char *path, vector<thread_trace> &threads) {
+    ifstream file(path, ios::binary | ios::ate);
+    uint64_t file_size = file.tellg();
+    file.seekg(0);
+    char magic[8];
+    uint32_t version, num_threads;
+    file.read(magic, sizeof(magic));
+    file.read((char *)&version, sizeof(version));
+    file.read((char *)&num_threads, sizeof(num_threads));
+    if (!file || memcmp(magic, trace_magic, sizeof(magic)) != 0 || version != trace_version) {
+        cerr << path << " is not a search trace" << endl;
+        return false;
+    }
+
+    // counts from the file are checked against its size before anything is allocated
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back();
+        thread_trace &thread = threads.back();
+        uint64_t kept;
+        file.read((char *)&thread.thread_index, sizeof(thread.thread_index));
+        file.read((char *)&thread.count, sizeof(thread.count));
+        file.read((char *)&kept, sizeof(kept));
+        if (!file || kept > thread.count || kept > (file_size - uint64_t(file.tellg())) / sizeof(trace_event)) {
+            cerr << path << " is truncated" << endl;
+            return false;
+        }
+        thread.events.resize(kept);
+        file.read((char *)thread.events.data(), kept * sizeof(trace_event));
+        if (!file) {
+            cerr << path << " is truncated" << endl;
+            return false;
+        }
+        // both are used as indexes below
+        for (const trace_event &event : thread.events) {
+            if (event.tt_outcome >= num_tt_outcomes || event.result >= num_results) {
+                cerr << path << " has a corrupt event" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void print_summary(const vector<thread_trace> &threads) {
+    uint64_t results[num_results] = {};
+    uint64_t tt_outcomes[num_tt_outcomes] = {};
+    uint64_t nodes_at_depth[max_depth] = {};
+    uint64_t cutoffs_at_depth[max_depth] = {};
+    uint64_t total = 0;
+
+    for (const thread_trace &thread : threads) {
+        cout << "thread " << thread.thread_index << ": " << thread.count << " events, " << thread.events.size() << " kept" << endl;
+        for (const trace_event &event : thread.events) {
+            ++results[event.result];
+            ++tt_outcomes[event.tt_outcome];
+            if (event.depth < max_depth) {
+                ++nodes_at_depth[event.depth];
+                cutoffs_at_depth[event.depth] += event.result == trace_cutoff;
+            }
+        }
+        total += thread.events.size();
+    }
+    if (!total)
+        return;
+
+    cout << "results" << endl;
+    for (int i = 0; i < num_results; ++i)
+        cout << "  " << result_names[i] << ": " << results[i] << " (" << 100.0 * results[i] / total << "%)" << endl;
+    cout << "tt probes" << endl;
+    for (int i = 0; i < num_tt_outcomes; ++i)
+        cout << "  " << tt_outcome_names[i] << ": " << tt_outcomes[i] << " (" << 100.0 * tt_outcomes[i] / total << "%)" << endl;
+    cout << "nodes by depth" << endl;
+    for (int depth = 0; depth < max_depth; ++depth) {
+        if (!nodes_at_depth[depth])
+            continue;
+        cout << "  " << depth << ": " << nodes_at_depth[depth] << " nodes, " << cutoffs_at_depth[depth] << " cutoffs" << endl;
+    }
+}
+
+// events are written when a node returns so a parent comes after its children
+void print_replay(const thread_trace &thread, uint64_t max_events) {
+    uint64_t first = thread.events.size() > max_events ? thread.events.size() - max_events : 0;
+    for (uint64_t i = first; i < thread.events.size(); ++i) {
+        const trace_event &event = thread.events[i];
+        cout << string(2 * event.depth, ' ') << hex << event.hash_key << dec
+             << " " << (event.marker ? 'X' : 'O')
+             << " [" << event.alpha << ", " << event.beta << "] = " << event.value
+             << " " << result_names[event.result] << " probe " << tt_outcome_names[event.tt_outcome] << endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    string mode = argc > 1 ? argv[1] : "";
+    vector<thread_trace> threads;
+
+    // ./trace.out summary search.trace
+    if (mode == "summary" && argc > 2) {
+        if (!load_trace(argv[2], threads))
+            return 1;
+        print_summary(threads);
+        return 0;
+    }
+    // ./trace.out replay search.trace [thread] [events]
+    if (mode == "replay" && argc > 2) {
+        if (!load_trace(argv[2], threads))
+            return 1;
+        uint32_t index = argc > 3 ? stoul(argv[3]) : 0;
+        uint64_t max_events = argc > 4 ? stoull(argv[4]) : 100;
+        for (const thread_trace &thread : threads) {
+            if (thread.thread_index == index) {
+                print_replay(thread, max_events);
+                return 0;
+            }
+        }
+        cerr << "no thread " << index << " in " << argv[2] << endl;
+        return 1;
+    }
+
+    cerr << "usage: " << argv[0] << " summary file | replay file [thread] [events]" << endl;
+    return 1;
+}